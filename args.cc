@@ -5,7 +5,10 @@
 #include <iostream>
 
 void print_usage() {
-    std::cout << "Usage: ipkcpd -h <host> -p <port> -m <mode>" << std::endl;
+    std::cout << "Usage: ipkcpd -h <host> -p <port> -m <mode> [-b <backend>] [-t <trace file>] "
+                 "[-s <sampling rate>] [-c <config file>] [-u <handoff socket>] "
+                 "[-w <snapshot file>]"
+              << std::endl;
     exit(0);
 }
 
@@ -14,8 +17,9 @@ Args::Args(int argc, char** argv) {
     int option;
     int parsed_port;
     bool host_set = false, port_set = false, mode_set = false;
-    std::string host, port;
-    while ((option = getopt(argc, argv, "h:p:m:")) != -1) {
+    std::string host, port, rate = "1";
+    backend = "socket";
+    while ((option = getopt(argc, argv, "h:p:m:b:t:s:c:u:w:")) != -1) {
         switch (option) {
             case 'h':
                 host = optarg;
@@ -29,6 +33,24 @@ Args::Args(int argc, char** argv) {
                 mode = optarg;
                 mode_set = true;
                 break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 't':
+                trace_file = optarg;
+                break;
+            case 's':
+                rate = optarg;
+                break;
+            case 'c':
+                config_file = optarg;
+                break;
+            case 'u':
+                handoff = optarg;
+                break;
+            case 'w':
+                snapshot = optarg;
+                break;
             default:  // Invalid option
                 print_usage();
         }
@@ -45,6 +67,12 @@ Args::Args(int argc, char** argv) {
         exit(1);
     }
 
+    // Check if backend is valid
+    if (backend != "socket" && backend != "packet") {
+        std::cerr << "Invalid backend. Please use 'socket' or 'packet'." << std::endl;
+        exit(1);
+    }
+
     // Parse address and check if it is valid
     if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) <= 0) {
         std::cerr << "Invalid address" << std::endl;
@@ -58,6 +86,13 @@ Args::Args(int argc, char** argv) {
         exit(1);
     }
 
+    // Parse sampling rate and check if it is valid
+    res = std::from_chars(rate.data(), rate.data() + rate.size(), trace_rate);
+    if (res.ec != std::errc() || trace_rate == 0) {
+        std::cerr << "Invalid sampling rate" << std::endl;
+        exit(1);
+    }
+
     // Set port and address family
     address.sin_port = htons(parsed_port);
     address.sin_family = AF_INET;
@@ -69,4 +104,6 @@ Args::Args() {
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(8080);
     mode = "tcp";
+    backend = "socket";
+    trace_rate = 1;
 }
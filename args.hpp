@@ -7,6 +7,12 @@ class Args {
    public:
     struct sockaddr_in address;
     std::string mode;
+    std::string backend;
+    std::string trace_file;
+    std::string config_file;
+    std::string handoff;
+    std::string snapshot;
+    unsigned trace_rate;
     Args(int argc, char** argv);
     Args();
 };
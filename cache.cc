@@ -0,0 +1,80 @@
+#include "cache.hpp"
+#include <algorithm>
+#include <mutex>
+
+ResultCache result_cache;
+
+std::optional<int> ResultCache::lookup(const std::string& query) {
+    if (capacity.load(std::memory_order_relaxed) == 0) {
+        return std::nullopt;
+    }
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = entries.find(query);
+    if (it == entries.end()) {
+        return std::nullopt;
+    }
+    it->second.hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second.result;
+}
+
+/**
+ * Drop entries that weren't used and halve hits of the others,
+ * so entries that used to be hot eventually make space for new ones
+ * Has to be called with exclusive lock
+ */
+void ResultCache::evict() {
+    for (auto it = entries.begin(); it != entries.end();) {
+        uint32_t hits = it->second.hits.load(std::memory_order_relaxed);
+        if (hits == 0) {
+            it = entries.erase(it);
+        } else {
+            it->second.hits.store(hits / 2, std::memory_order_relaxed);
+            it++;
+        }
+    }
+}
+
+void ResultCache::insert(const std::string& query, int result, uint32_t hits) {
+    size_t max = capacity.load(std::memory_order_relaxed);
+    if (max == 0 || query.length() > max_cached_query) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (entries.size() >= max) {
+        evict();
+        if (entries.size() >= max) {
+            return;
+        }
+    }
+    entries.try_emplace(query, result, hits);
+}
+
+std::vector<CacheEntry> ResultCache::hot(size_t limit) {
+    std::vector<CacheEntry> result;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        result.reserve(entries.size());
+        for (auto& [query, entry] : entries) {
+            result.push_back({query, entry.result, entry.hits.load(std::memory_order_relaxed)});
+        }
+    }
+    // Most used first
+    std::sort(result.begin(), result.end(),
+              [](const CacheEntry& a, const CacheEntry& b) { return a.hits > b.hits; });
+    if (result.size() > limit) {
+        result.resize(limit);
+    }
+    return result;
+}
+
+void ResultCache::set_capacity(size_t new_capacity) {
+    capacity.store(new_capacity, std::memory_order_relaxed);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // Shrink if needed, drop cold entries first
+    while (entries.size() > new_capacity) {
+        evict();
+        if (new_capacity == 0) {
+            entries.clear();
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __CACHE_HPP__
+#define __CACHE_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Longer queries are not cached
+constexpr size_t max_cached_query = 255;
+
+/**
+ * Cached result of a query
+ */
+struct CacheEntry {
+    std::string query;
+    int result;
+    uint32_t hits;
+};
+
+/**
+ * Thread safe cache of query results, shared by all clients
+ */
+class ResultCache {
+    struct Entry {
+        int result;
+        std::atomic<uint32_t> hits;
+        Entry(int result, uint32_t hits) : result(result), hits(hits) {}
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::shared_mutex mutex;
+    std::atomic<size_t> capacity{0};
+
+    void evict();
+
+   public:
+    /**
+     * Get cached result of the query
+     */
+    std::optional<int> lookup(const std::string& query);
+    /**
+     * Store result of the query, existing entry is kept
+     * @param hits Initial hit count (used when loading snapshot)
+     */
+    void insert(const std::string& query, int result, uint32_t hits = 0);
+    /**
+     * Get most used entries, most used first
+     * @param limit Maximum number of entries
+     */
+    std::vector<CacheEntry> hot(size_t limit);
+    /**
+     * Change maximum number of entries (0 disables the cache)
+     */
+    void set_capacity(size_t capacity);
+};
+
+// Cache shared by all parsers
+extern ResultCache result_cache;
+
+#endif  // __CACHE_HPP__
@@ -0,0 +1,92 @@
+#include "config.hpp"
+#include <charconv>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Remove leading and trailing whitespace
+ */
+std::string trim(std::string str) {
+    auto start = str.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return "";
+    }
+    auto end = str.find_last_not_of(" \t\r");
+    return str.substr(start, end - start + 1);
+}
+
+/**
+ * Parse number
+ * @param str String to parse
+ * @param value Parsed value
+ * @param min Minimal allowed value
+ * @return False if the string is not a number or is too small
+ */
+template <typename T>
+bool parse_number(std::string str, T& value, T min) {
+    auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    return res.ec == std::errc() && res.ptr == str.data() + str.size() && value >= min;
+}
+
+bool Config::load(std::string path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Can't open config file " << path << std::endl;
+        return false;
+    }
+
+    // Parse into a copy, so invalid file doesn't leave config half applied
+    Config loaded = *this;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        // Remove comment
+        std::string content = trim(line.substr(0, line.find('#')));
+        if (content.empty()) {
+            continue;
+        }
+
+        auto eq = content.find('=');
+        bool valid = false;
+        if (eq != std::string::npos) {
+            std::string key = trim(content.substr(0, eq));
+            std::string value = trim(content.substr(eq + 1));
+            if (key == "backlog") {
+                valid = parse_number(value, loaded.backlog, 1);
+            } else if (key == "trace_rate") {
+                valid = parse_number(value, loaded.trace_rate, 1u);
+            } else if (key == "cache_size") {
+                valid = parse_number(value, loaded.cache_size, (size_t)0);
+            } else if (key == "snapshot_interval") {
+                valid = parse_number(value, loaded.snapshot_interval, 1u);
+            } else if (key == "drain_timeout") {
+                valid = parse_number(value, loaded.drain_timeout, 0u);
+            }
+        }
+        if (!valid) {
+            std::cerr << "Invalid config on line " << line_number << ": " << line << std::endl;
+            return false;
+        }
+    }
+
+    *this = loaded;
+    return true;
+}
+
+Config::Config(Args args) : Config() {
+    trace_rate = args.trace_rate;
+    // Cache is meant to be warmed up from the snapshot, without it it's opt-in
+    if (!args.snapshot.empty()) {
+        cache_size = 1024;
+    }
+}
+
+Config::Config() {
+    // Set default values
+    backlog = 3;
+    trace_rate = 1;
+    cache_size = 0;
+    snapshot_interval = 60;
+    drain_timeout = 30;
+}
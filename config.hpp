@@ -0,0 +1,35 @@
+#ifndef __CONFIG_HPP__
+#define __CONFIG_HPP__
+
+#include <string>
+#include "args.hpp"
+
+/**
+ * Runtime tunables, they can be reloaded from the config file on SIGHUP
+ *
+ * Config file contains `key = value` lines, `#` starts a comment
+ */
+class Config {
+   public:
+    // Length of the TCP listen queue
+    int backlog;
+    // Trace one in every `trace_rate` requests
+    unsigned trace_rate;
+    // Maximum number of cached results (0 disables the cache, default 1024 with -w, else 0)
+    size_t cache_size;
+    // Seconds between cache snapshots
+    unsigned snapshot_interval;
+    // Seconds to let TCP clients finish after handing off the server socket
+    unsigned drain_timeout;
+
+    /**
+     * Load tunables from the config file, values missing in the file are kept
+     * @param path Path to the config file
+     * @return False if the file can't be read or is invalid (nothing is changed then)
+     */
+    bool load(std::string path);
+    Config(Args args);
+    Config();
+};
+
+#endif  // __CONFIG_HPP__
@@ -0,0 +1,195 @@
+#ifndef __EVALUATOR_HPP__
+#define __EVALUATOR_HPP__
+
+#include <climits>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "parser.hpp"
+
+namespace evaluator {
+
+// Number of independent lanes used by fold
+constexpr size_t lanes = 8;
+
+/**
+ * Fold values into single result using independent lanes
+ * Lanes don't depend on each other, so the compiler can turn the loop into SIMD
+ * @param values Values to fold
+ * @param init Initial value of every lane
+ * @param map Maps value to the lane type
+ * @param combine Associative and commutative operation
+ */
+template <typename T, typename Map, typename Combine>
+constexpr T fold(std::span<const int> values, T init, Map map, Combine combine) {
+    T lane[lanes];
+    for (auto& l : lane) {
+        l = init;
+    }
+    size_t i = 0;
+    for (; i + lanes <= values.size(); i += lanes) {
+        for (size_t j = 0; j < lanes; j++) {
+            lane[j] = combine(lane[j], map(values[i + j]));
+        }
+    }
+    // Remaining values
+    for (; i < values.size(); i++) {
+        lane[0] = combine(lane[0], map(values[i]));
+    }
+    T result = init;
+    for (auto& l : lane) {
+        result = combine(result, l);
+    }
+    return result;
+}
+
+/**
+ * Sum of values (wraps around on overflow)
+ */
+constexpr unsigned sum(std::span<const int> values) {
+    return fold(
+        values, 0u, [](int v) { return (unsigned)v; }, [](unsigned a, unsigned b) { return a + b; });
+}
+
+/**
+ * Product of values (wraps around on overflow)
+ */
+constexpr unsigned product(std::span<const int> values) {
+    return fold(
+        values, 1u, [](int v) { return (unsigned)v; }, [](unsigned a, unsigned b) { return a * b; });
+}
+
+/**
+ * Check if any of the values is zero, without early exit
+ */
+constexpr bool contains_zero(std::span<const int> values) {
+    return fold(
+        values, 0u, [](int v) { return (unsigned)(v == 0); },
+        [](unsigned a, unsigned b) { return a | b; });
+}
+
+/**
+ * Reduce operands with operator known at compile time
+ * @param operands At least two operands
+ * @return The result of the operation (or nullopt if operation is invalid)
+ */
+template <TokenType Op>
+constexpr std::optional<int> reduce(std::span<const int> operands) {
+    int first = operands[0];
+    auto rest = operands.subspan(1);
+    if constexpr (Op == TokenType::Plus) {
+        return (int)(first + sum(rest));
+    } else if constexpr (Op == TokenType::Minus) {
+        return (int)(first - sum(rest));
+    } else if constexpr (Op == TokenType::Multiply) {
+        return (int)(first * product(rest));
+    } else if constexpr (Op == TokenType::Divide) {
+        // Division by zero, checked for all operands up front
+        if (contains_zero(rest)) {
+            return std::nullopt;
+        }
+        // Division is not associative, so this has to be done in order
+        int result = first;
+        for (int operand : rest) {
+            // Result doesn't fit into int (and traps on x86)
+            if (result == INT_MIN && operand == -1) {
+                return std::nullopt;
+            }
+            result /= operand;
+        }
+        return result;
+    } else {
+        return std::nullopt;
+    }
+}
+
+/**
+ * Evaluator usable at compile time, follows the same grammar as Parser
+ */
+class ConstantEvaluator {
+    std::string_view query;
+    size_t pos = 0;
+
+    constexpr bool accept(char c) {
+        if (pos < query.size() && query[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    constexpr std::optional<int> rule_expr() {
+        if (accept('(')) {
+            return rule_subexp();
+        }
+        size_t start = pos;
+        int value = 0;
+        while (pos < query.size() && query[pos] >= '0' && query[pos] <= '9') {
+            value = value * 10 + (query[pos++] - '0');
+        }
+        if (pos == start) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    constexpr std::optional<int> rule_subexp() {
+        if (pos >= query.size()) {
+            return std::nullopt;
+        }
+        char op = query[pos++];
+        std::vector<int> operands;
+        while (accept(' ')) {
+            auto expr = rule_expr();
+            if (!expr) {
+                return std::nullopt;
+            }
+            operands.push_back(expr.value());
+        }
+        if (operands.size() < 2 || !accept(')')) {
+            return std::nullopt;
+        }
+        switch (op) {
+            case '+':
+                return reduce<TokenType::Plus>(operands);
+            case '-':
+                return reduce<TokenType::Minus>(operands);
+            case '*':
+                return reduce<TokenType::Multiply>(operands);
+            case '/':
+                return reduce<TokenType::Divide>(operands);
+            default:
+                return std::nullopt;
+        }
+    }
+
+   public:
+    constexpr ConstantEvaluator(std::string_view query) : query(query) {}
+
+    /**
+     * Evaluate the whole query
+     */
+    constexpr std::optional<int> evaluate() {
+        if (!accept('(')) {
+            return std::nullopt;
+        }
+        auto result = rule_subexp();
+        if (!result || pos != query.size()) {
+            return std::nullopt;
+        }
+        return result;
+    }
+};
+
+/**
+ * Evaluate query at compile time
+ */
+constexpr std::optional<int> evaluate(std::string_view query) {
+    return ConstantEvaluator(query).evaluate();
+}
+
+}  // namespace evaluator
+
+#endif  // __EVALUATOR_HPP__
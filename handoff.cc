@@ -0,0 +1,180 @@
+#include "handoff.hpp"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+/**
+ * Fill unix socket address
+ * @param path Path of the socket
+ * @param addr Address to fill
+ */
+void unix_address(std::string path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    path.copy(addr->sun_path, sizeof(addr->sun_path) - 1);
+}
+
+// Reply byte telling whether the socket is attached
+const char reply_ok = 0;
+const char reply_refused = 1;
+
+/**
+ * Socket requested by the new process
+ */
+struct Request {
+    int type;
+    struct sockaddr_in address;
+};
+
+int Handoff::receive(int type, struct sockaddr_in address) {
+    if (path.empty()) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_un addr;
+    unix_address(path, &addr);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        // No process is running
+        close(sock);
+        return -1;
+    }
+
+    // Running process checks the type and address before giving up its socket
+    Request request = {type, address};
+    if (::send(sock, &request, sizeof(request), 0) != sizeof(request)) {
+        perror("send");
+        exit(EXIT_FAILURE);
+    }
+
+    // Socket comes as ancillary data along with single byte
+    char byte;
+    struct iovec iov = {&byte, 1};
+    char control_buffer[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buffer;
+    msg.msg_controllen = sizeof(control_buffer);
+    ssize_t n = recvmsg(sock, &msg, 0);
+    close(sock);
+
+    if (n == 1 && byte == reply_refused) {
+        std::cerr << "Running server uses different mode or address" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (n != 1 || cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        std::cerr << "Socket handoff failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    int received;
+    memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+    return received;
+}
+
+void Handoff::listen() {
+    if (path.empty()) {
+        return;
+    }
+
+    // Take over the path from the previous process (or remove stale socket)
+    unlink(path.c_str());
+    if ((control = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_un addr;
+    unix_address(path, &addr);
+    if (bind(control, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+    if (::listen(control, 1) < 0) {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool Handoff::accept(int socket) {
+    peer = ::accept(control, nullptr, nullptr);
+    if (peer < 0) {
+        perror("accept");
+        return false;
+    }
+
+    // Don't let a stuck process block the server
+    struct timeval timeout = {1, 0};
+    setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    Request request;
+    int own_type;
+    socklen_t type_len = sizeof(own_type);
+    struct sockaddr_in own_address;
+    socklen_t address_len = sizeof(own_address);
+    if (recv(peer, &request, sizeof(request), MSG_WAITALL) != sizeof(request) ||
+        getsockopt(socket, SOL_SOCKET, SO_TYPE, &own_type, &type_len) < 0 ||
+        getsockname(socket, (struct sockaddr*)&own_address, &address_len) < 0 ||
+        request.type != own_type || request.address.sin_family != own_address.sin_family ||
+        request.address.sin_port != own_address.sin_port ||
+        request.address.sin_addr.s_addr != own_address.sin_addr.s_addr) {
+        std::cerr << "Refused handoff to process with different mode or address" << std::endl;
+        ::send(peer, &reply_refused, 1, MSG_NOSIGNAL);
+        close(peer);
+        peer = -1;
+        return false;
+    }
+    return true;
+}
+
+bool Handoff::send(int socket) {
+    char byte = reply_ok;
+    struct iovec iov = {&byte, 1};
+    char control_buffer[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buffer;
+    msg.msg_controllen = sizeof(control_buffer);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &socket, sizeof(socket));
+    if (sendmsg(peer, &msg, MSG_NOSIGNAL) != 1) {
+        perror("sendmsg");
+        close(peer);
+        peer = -1;
+        return false;
+    }
+    close(peer);
+    peer = -1;
+
+    // Path now belongs to the new process, don't unlink it
+    close(control);
+    control = -1;
+    return true;
+}
+
+int Handoff::fd() {
+    return control;
+}
+
+Handoff::Handoff(std::string path) : path(path) {}
+
+Handoff::~Handoff() {
+    if (peer >= 0) {
+        close(peer);
+    }
+    if (control >= 0) {
+        close(control);
+    }
+}
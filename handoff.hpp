@@ -0,0 +1,56 @@
+#ifndef __HANDOFF_HPP__
+#define __HANDOFF_HPP__
+
+#include <netinet/in.h>
+#include <string>
+
+/**
+ * Passes server socket from running process to a new one over unix socket
+ *
+ * New process connects to the control socket of the old one, sends the type
+ * and address of socket it needs and receives the server socket with SCM_RIGHTS.
+ * Then it takes over the control socket, so it can be replaced the same way later.
+ * When the type or address doesn't match, the old process refuses and keeps serving.
+ */
+class Handoff {
+    std::string path;
+    int control = -1;
+    // Accepted connection of the new process
+    int peer = -1;
+
+   public:
+    /**
+     * Try to receive server socket from running process
+     * Exits if the running process serves a different type of socket or address
+     * @param type Type of the needed socket (SOCK_STREAM or SOCK_DGRAM)
+     * @param address Address the socket has to be bound to
+     * @return Received socket or -1 if there is no running process
+     */
+    int receive(int type, struct sockaddr_in address);
+    /**
+     * Start listening for a new process
+     */
+    void listen();
+    /**
+     * Accept the new process that is connecting and check it needs this socket
+     * (same type and bound address)
+     * @param socket Server socket
+     * @return False if the new process was refused (keep serving then)
+     */
+    bool accept(int socket);
+    /**
+     * Pass server socket to the accepted process
+     * @param socket Server socket
+     * @return False if the socket couldn't be passed (keep serving then)
+     */
+    bool send(int socket);
+    /**
+     * Control socket to wait on (-1 if handoff is disabled)
+     */
+    int fd();
+    Handoff(std::string path);
+    Handoff(const Handoff&) = delete;
+    ~Handoff();
+};
+
+#endif  // __HANDOFF_HPP__
@@ -1,13 +1,19 @@
 #include "args.hpp"
 #include "server.hpp"
+#include "trace.hpp"
 
 int main(int argc, char* argv[]) {
     // Parse command line arguments
     Args args(argc, argv);
+    // Set up request tracing
+    if (!args.trace_file.empty()) {
+        trace::init(args.trace_file, args.trace_rate);
+    }
     // Create server
     Server* server = Server::create(args);
     // Run server
     server->run();
     delete server;
+    trace::stop();
     return 0;
 }
@@ -0,0 +1,416 @@
+#include "packet-ring.hpp"
+#include <ifaddrs.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "trace.hpp"
+
+// Receive ring geometry
+constexpr unsigned rx_block_size = 1 << 16;
+constexpr unsigned rx_block_nr = 64;
+constexpr unsigned rx_frame_size = 2048;
+// Maximum time in ms before partially filled block is handed to us
+constexpr unsigned rx_block_timeout = 1;
+
+// Transmit ring geometry
+constexpr unsigned tx_block_size = 1 << 16;
+constexpr unsigned tx_block_nr = 16;
+constexpr unsigned tx_frame_size = 2048;
+
+// Offset of the packet data in transmit frame
+constexpr size_t tx_data_offset = TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+// Offsets of the headers in the packet
+constexpr size_t ip_offset = sizeof(struct ethhdr);
+constexpr size_t udp_offset = ip_offset + sizeof(struct iphdr);
+constexpr size_t payload_offset = udp_offset + sizeof(struct udphdr);
+
+/**
+ * Add data to the internet checksum
+ * @param sum Partial sum
+ * @param data Data to add
+ * @param len Length of the data
+ * @return New partial sum
+ */
+uint32_t checksum_add(uint32_t sum, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (len & 1) {
+        sum += data[len - 1] << 8;
+    }
+    return sum;
+}
+
+/**
+ * Finish internet checksum
+ * @param sum Partial sum
+ * @return Checksum in network byte order
+ */
+uint16_t checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(~sum);
+}
+
+/**
+ * Check if IPv4 interface option is enabled for the interface (or for all interfaces)
+ * @param ifname Interface name
+ * @param option Option name in /proc/sys/net/ipv4/conf/<interface>/
+ */
+bool conf_enabled(std::string ifname, std::string option) {
+    for (auto& name : {ifname, std::string("all")}) {
+        std::ifstream file("/proc/sys/net/ipv4/conf/" + name + "/" + option);
+        int value = 0;
+        if (file >> value && value != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Find index of the interface that owns the bound address
+ */
+bool PacketRing::find_interface() {
+    if (address.sin_addr.s_addr == INADDR_ANY) {
+        std::cerr << "Packet ring needs a specific host address" << std::endl;
+        return false;
+    }
+
+    struct ifaddrs* ifaddr;
+    if (getifaddrs(&ifaddr) < 0) {
+        perror("getifaddrs");
+        return false;
+    }
+    for (auto* ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != AF_INET) {
+            continue;
+        }
+        if (((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr != address.sin_addr.s_addr) {
+            continue;
+        }
+        // Frames injected on loopback have local source address, which the kernel
+        // drops as martian unless accept_local (and route_localnet for 127/8) is set
+        if (ifa->ifa_flags & IFF_LOOPBACK) {
+            bool localnet = (ntohl(address.sin_addr.s_addr) >> 24) == 127;
+            if (!conf_enabled(ifa->ifa_name, "accept_local") ||
+                (localnet && !conf_enabled(ifa->ifa_name, "route_localnet"))) {
+                std::cerr << "Packet ring on loopback needs net.ipv4.conf." << ifa->ifa_name
+                          << ".accept_local=1" << (localnet ? " and route_localnet=1" : "")
+                          << std::endl;
+                freeifaddrs(ifaddr);
+                return false;
+            }
+        }
+        ifindex = if_nametoindex(ifa->ifa_name);
+        break;
+    }
+    freeifaddrs(ifaddr);
+
+    if (ifindex == 0) {
+        std::cerr << "No interface with the host address" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Set up TPACKET_V3 receive ring
+ */
+bool PacketRing::setup_rx() {
+    if ((rx_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP))) < 0) {
+        perror("socket");
+        return false;
+    }
+
+    // Let the kernel drop everything except unfragmented UDP to our port
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, IP_MF | IP_OFFMASK, 4, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohs(address.sin_port), 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog filter = {sizeof(code) / sizeof(code[0]), code};
+    if (setsockopt(rx_socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+
+    // Our own responses are outgoing, we don't want to see them (not fatal on older kernels)
+    int opt = 1;
+    setsockopt(rx_socket, SOL_PACKET, PACKET_IGNORE_OUTGOING, &opt, sizeof(opt));
+
+    int version = TPACKET_V3;
+    if (setsockopt(rx_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+
+    rx_req.tp_block_size = rx_block_size;
+    rx_req.tp_block_nr = rx_block_nr;
+    rx_req.tp_frame_size = rx_frame_size;
+    rx_req.tp_frame_nr = rx_block_size / rx_frame_size * rx_block_nr;
+    rx_req.tp_retire_blk_tov = rx_block_timeout;
+    if (setsockopt(rx_socket, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+
+    void* map = mmap(nullptr, rx_block_size * rx_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     rx_socket, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    rx_map = (uint8_t*)map;
+
+    // Bind to the interface
+    struct sockaddr_ll ll = {};
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = ifindex;
+    if (bind(rx_socket, (struct sockaddr*)&ll, sizeof(ll)) < 0) {
+        perror("bind");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Set up TPACKET_V2 transmit ring
+ */
+bool PacketRing::setup_tx() {
+    // Protocol 0 means that this socket won't receive anything
+    if ((tx_socket = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        perror("socket");
+        return false;
+    }
+
+    int version = TPACKET_V2;
+    if (setsockopt(tx_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+
+    // Skip malformed frames instead of stopping transmission
+    int opt = 1;
+    setsockopt(tx_socket, SOL_PACKET, PACKET_LOSS, &opt, sizeof(opt));
+
+    tx_req.tp_block_size = tx_block_size;
+    tx_req.tp_block_nr = tx_block_nr;
+    tx_req.tp_frame_size = tx_frame_size;
+    tx_req.tp_frame_nr = tx_block_size / tx_frame_size * tx_block_nr;
+    if (setsockopt(tx_socket, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+
+    void* map = mmap(nullptr, tx_block_size * tx_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     tx_socket, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    tx_map = (uint8_t*)map;
+    return true;
+}
+
+bool PacketRing::setup(struct sockaddr_in address, int udp_socket) {
+    this->address = address;
+    if (!find_interface() || !setup_rx() || !setup_tx()) {
+        return false;
+    }
+
+    // Requests are answered from the ring, so the UDP socket shouldn't queue them anymore
+    // The socket stays bound, so the kernel doesn't reply with ICMP port unreachable
+    struct sock_filter code[] = {BPF_STMT(BPF_RET | BPF_K, 0)};
+    struct sock_fprog filter = {1, code};
+    if (setsockopt(udp_socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+        perror("setsockopt");
+        return false;
+    }
+    this->udp_socket = udp_socket;
+    return true;
+}
+
+/**
+ * Get next free transmit frame
+ * @return Pointer to the frame or nullptr if the ring is full
+ */
+uint8_t* PacketRing::next_tx_frame() {
+    auto* hdr = (struct tpacket2_hdr*)(tx_map + tx_frame * tx_req.tp_frame_size);
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+        // Ring is full, wait for the kernel to send pending frames
+        flush();
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            return nullptr;
+        }
+    }
+    tx_frame = (tx_frame + 1) % tx_req.tp_frame_nr;
+    return (uint8_t*)hdr;
+}
+
+/**
+ * Send all pending transmit frames
+ */
+void PacketRing::flush() {
+    if (tx_pending == 0) {
+        return;
+    }
+    trace::Scope scope(Stage::Send);
+    struct sockaddr_ll ll = {};
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = ifindex;
+    // Blocks until all frames are sent
+    sendto(tx_socket, nullptr, 0, 0, (struct sockaddr*)&ll, sizeof(ll));
+    tx_pending = 0;
+}
+
+/**
+ * Process single received frame and queue the response
+ * @param frame Frame starting with ethernet header
+ * @param len Length of the frame
+ * @param handler Request handler
+ */
+void PacketRing::handle_frame(uint8_t* frame, size_t len, const RequestHandler& handler) {
+    if (len < payload_offset) {
+        return;
+    }
+    auto* eth = (struct ethhdr*)frame;
+    auto* ip = (struct iphdr*)(frame + ip_offset);
+    size_t ip_len = ip->ihl * 4;
+    if (eth->h_proto != htons(ETH_P_IP) || ip->version != 4 || ip_len < sizeof(struct iphdr) ||
+        ip->protocol != IPPROTO_UDP || (ip->frag_off & htons(IP_MF | IP_OFFMASK)) ||
+        ip->daddr != address.sin_addr.s_addr) {
+        return;
+    }
+    if (len < ip_offset + ip_len + sizeof(struct udphdr)) {
+        return;
+    }
+    auto* udp = (struct udphdr*)(frame + ip_offset + ip_len);
+    size_t udp_len = ntohs(udp->len);
+    if (udp->dest != address.sin_port || udp_len < sizeof(struct udphdr) ||
+        ip_offset + ip_len + udp_len > len) {
+        return;
+    }
+
+    uint8_t* tx = next_tx_frame();
+    if (tx == nullptr) {
+        // No space for the response, drop the request
+        return;
+    }
+    uint8_t* out = tx + tx_data_offset;
+
+    // Write response payload straight into the transmit frame
+    const char* request = (const char*)udp + sizeof(struct udphdr);
+    size_t n = handler(request, udp_len - sizeof(struct udphdr), (char*)out + payload_offset);
+
+    // Ethernet header, swap addresses
+    auto* out_eth = (struct ethhdr*)out;
+    memcpy(out_eth->h_dest, eth->h_source, ETH_ALEN);
+    memcpy(out_eth->h_source, eth->h_dest, ETH_ALEN);
+    out_eth->h_proto = htons(ETH_P_IP);
+
+    // IP header
+    auto* out_ip = (struct iphdr*)(out + ip_offset);
+    *out_ip = {};
+    out_ip->version = 4;
+    out_ip->ihl = sizeof(struct iphdr) / 4;
+    out_ip->tot_len = htons(sizeof(struct iphdr) + sizeof(struct udphdr) + n);
+    out_ip->frag_off = htons(IP_DF);
+    out_ip->ttl = 64;
+    out_ip->protocol = IPPROTO_UDP;
+    out_ip->saddr = ip->daddr;
+    out_ip->daddr = ip->saddr;
+    out_ip->check = checksum_fold(checksum_add(0, (uint8_t*)out_ip, sizeof(struct iphdr)));
+
+    // UDP header, checksum includes pseudo header
+    auto* out_udp = (struct udphdr*)(out + udp_offset);
+    out_udp->source = udp->dest;
+    out_udp->dest = udp->source;
+    out_udp->len = htons(sizeof(struct udphdr) + n);
+    out_udp->check = 0;
+    uint32_t sum = checksum_add(0, (uint8_t*)&out_ip->saddr, 8);
+    sum += IPPROTO_UDP + sizeof(struct udphdr) + n;
+    sum = checksum_add(sum, (uint8_t*)out_udp, sizeof(struct udphdr) + n);
+    out_udp->check = checksum_fold(sum);
+    if (out_udp->check == 0) {
+        out_udp->check = 0xffff;
+    }
+
+    // Hand the frame over to the kernel
+    auto* hdr = (struct tpacket2_hdr*)tx;
+    hdr->tp_len = payload_offset + n;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    tx_pending++;
+}
+
+void PacketRing::run(const RequestHandler& handler, const WaitHandler& wait) {
+    while (true) {
+        auto* block = (struct tpacket_block_desc*)(rx_map + rx_block * rx_req.tp_block_size);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            // Wait for the kernel to fill the block
+            if (!wait(rx_socket)) {
+                return;
+            }
+            continue;
+        }
+
+        // Walk all packets in the block
+        auto* packet = (struct tpacket3_hdr*)((uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            auto* ll = (struct sockaddr_ll*)((uint8_t*)packet +
+                                             TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            if (ll->sll_pkttype == PACKET_HOST) {
+                trace::begin_request();
+                handle_frame((uint8_t*)packet + packet->tp_mac, packet->tp_snaplen, handler);
+            }
+            packet = (struct tpacket3_hdr*)((uint8_t*)packet + packet->tp_next_offset);
+        }
+
+        // Send responses for the whole block at once
+        flush();
+
+        // Return the block to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        rx_block = (rx_block + 1) % rx_req.tp_block_nr;
+    }
+}
+
+PacketRing::~PacketRing() {
+    // Let the UDP socket queue requests again
+    if (udp_socket >= 0) {
+        int opt = 0;
+        setsockopt(udp_socket, SOL_SOCKET, SO_DETACH_FILTER, &opt, sizeof(opt));
+    }
+    if (rx_map != nullptr) {
+        munmap(rx_map, rx_block_size * rx_block_nr);
+    }
+    if (tx_map != nullptr) {
+        munmap(tx_map, tx_block_size * tx_block_nr);
+    }
+    if (rx_socket >= 0) {
+        close(rx_socket);
+    }
+    if (tx_socket >= 0) {
+        close(tx_socket);
+    }
+}
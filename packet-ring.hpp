@@ -0,0 +1,64 @@
+#ifndef __PACKET_RING_HPP__
+#define __PACKET_RING_HPP__
+
+#include <linux/if_packet.h>
+#include <netinet/in.h>
+#include <cstdint>
+#include <functional>
+
+/**
+ * Request handler, writes response for the given request
+ * Returns length of the response
+ */
+using RequestHandler = std::function<size_t(const char* request, size_t n, char* response)>;
+
+/**
+ * Waits until the socket is readable
+ * Returns false if the ring should stop
+ */
+using WaitHandler = std::function<bool(int socket)>;
+
+/**
+ * UDP fast path using AF_PACKET mmap rings
+ * Requests are read straight from the TPACKET_V3 receive ring
+ * and responses are written in place into the TPACKET_V2 transmit ring
+ */
+class PacketRing {
+    struct sockaddr_in address;
+    int ifindex = 0;
+    int udp_socket = -1;
+
+    int rx_socket = -1;
+    uint8_t* rx_map = nullptr;
+    struct tpacket_req3 rx_req = {};
+    unsigned rx_block = 0;
+
+    int tx_socket = -1;
+    uint8_t* tx_map = nullptr;
+    struct tpacket_req tx_req = {};
+    unsigned tx_frame = 0;
+    unsigned tx_pending = 0;
+
+    bool find_interface();
+    bool setup_rx();
+    bool setup_tx();
+    void handle_frame(uint8_t* frame, size_t len, const RequestHandler& handler);
+    uint8_t* next_tx_frame();
+    void flush();
+
+   public:
+    /**
+     * Set up rings on the interface owning the address
+     * @param address Address and port the server is bound to
+     * @param udp_socket Bound UDP socket, its queue is disabled while the ring is open
+     * @return False if rings are not available and socket path should be used
+     */
+    bool setup(struct sockaddr_in address, int udp_socket);
+    /**
+     * Receive and answer requests until `wait` returns false
+     */
+    void run(const RequestHandler& handler, const WaitHandler& wait);
+    ~PacketRing();
+};
+
+#endif  // __PACKET_RING_HPP__
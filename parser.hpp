@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <optional>
+#include <span>
 #include <vector>
 
 enum class TokenType { LeftParen, RightParen, Plus, Minus, Multiply, Divide, Number, Space, End };
@@ -25,10 +26,10 @@ class Parser {
 
     std::optional<int> rule_query();
     std::optional<int> rule_expr();
-    std::optional<std::vector<int>> rule_optexpr();
+    bool rule_optexpr(std::vector<int>& results);
     std::optional<int> rule_subexp();
 
-    std::optional<int> do_operation(TokenType op, std::vector<int> results);
+    std::optional<int> do_operation(TokenType op, std::span<const int> operands);
 
     bool rule_operator();
     bool check_rule(TokenType type);
@@ -1,9 +1,179 @@
 #include "server.hpp"
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include "cache.hpp"
+#include "snapshot.hpp"
 #include "tcp-server.hpp"
+#include "trace.hpp"
 #include "udp-server.hpp"
 
-Server::Server(Args args) {
+// Signalled on SIGHUP
+int reload_event = -1;
+// Signalled on SIGINT
+int shutdown_event = -1;
+
+/**
+ * Apply tunables of the shared modules
+ */
+void apply_tunables(Config& config) {
+    trace::set_rate(config.trace_rate);
+    result_cache.set_capacity(config.cache_size);
+    snapshot::set_interval(config.snapshot_interval);
+}
+
+/**
+ * Reload signal handler
+ */
+void reload_signalhandler(int signum) {
+    uint64_t one = 1;
+    write(reload_event, &one, sizeof(one));
+}
+
+/**
+ * Shutdown signal handler
+ * Shutdown itself is done by the server loop, it isn't safe to do it here
+ */
+void shutdown_signalhandler(int signum) {
+    uint64_t one = 1;
+    write(shutdown_event, &one, sizeof(one));
+}
+
+Server::Server(Args args) : config(args), handoff(args.handoff) {
     this->args = args;
+
+    // Set up the shutdown signal handler
+    if ((shutdown_event = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+    struct sigaction a;
+    a.sa_handler = shutdown_signalhandler;
+    a.sa_flags = SA_RESTART;
+    sigemptyset(&a.sa_mask);
+    sigaction(SIGINT, &a, NULL);
+
+    if (!args.config_file.empty()) {
+        if (!config.load(args.config_file)) {
+            exit(1);
+        }
+
+        // Config is reloaded from the server loop, handler only wakes it up
+        if ((reload_event = eventfd(0, EFD_NONBLOCK)) < 0) {
+            perror("eventfd");
+            exit(EXIT_FAILURE);
+        }
+        a.sa_handler = reload_signalhandler;
+        sigemptyset(&a.sa_mask);
+        sigaction(SIGHUP, &a, NULL);
+    }
+    apply_tunables(config);
+}
+
+Server::~Server() {
+    // After handoff the new process owns the snapshot, it was saved before handing over
+    snapshot::stop(!handed_off);
+}
+
+int Server::open_socket(int type) {
+    // Running process checks mode and address before handing over, so no port is left unserved
+    int sock = handoff.receive(type, args.address);
+    if (sock < 0) {
+        int opt = 1;
+        int addrlen = sizeof(args.address);
+
+        if ((sock = socket(AF_INET, type, 0)) < 0) {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
+
+        // Attach socket to the port
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+            perror("setsockopt");
+            exit(EXIT_FAILURE);
+        }
+
+        // Bind socket to the address and port
+        if (bind(sock, (struct sockaddr*)&args.address, addrlen) < 0) {
+            perror("bind");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Next process can take over from us
+    handoff.listen();
+
+    // Warm up the result cache, previous process saved its snapshot before handing over
+    if (!args.snapshot.empty()) {
+        snapshot::start_loading(args.snapshot);
+        snapshot::start_saving(args.snapshot, config.snapshot_interval);
+    }
+    return sock;
+}
+
+Wake Server::wait(int socket) {
+    while (true) {
+        struct pollfd fds[] = {
+            {socket, POLLIN, 0},
+            {handoff.fd(), POLLIN, 0},
+            {reload_event, POLLIN, 0},
+            {shutdown_event, POLLIN, 0},
+        };
+        if (poll(fds, 4, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        // Reload config, invalid config is reported and ignored
+        if (fds[2].revents & POLLIN) {
+            uint64_t count;
+            read(reload_event, &count, sizeof(count));
+            if (config.load(args.config_file)) {
+                apply_tunables(config);
+                apply_config();
+            }
+        }
+        // Shutdown event is not consumed, so every later wait returns right away
+        if (fds[3].revents & POLLIN) {
+            return Wake::Shutdown;
+        }
+        // New process is connecting
+        if (fds[1].revents & POLLIN) {
+            return Wake::Handoff;
+        }
+        if (fds[0].revents != 0) {
+            return Wake::Ready;
+        }
+    }
+}
+
+bool Server::hand_off(int socket) {
+    return handoff.accept(socket) && send_socket(socket);
+}
+
+bool Server::send_socket(int socket) {
+    // New process loads the snapshot once it has the socket, so it gets our hot entries
+    snapshot::stop(true);
+    if (handoff.send(socket)) {
+        handed_off = true;
+        return true;
+    }
+    if (!args.snapshot.empty()) {
+        snapshot::start_saving(args.snapshot, config.snapshot_interval);
+    }
+    return false;
+}
+
+bool Server::wait_shutdown(int timeout) {
+    struct pollfd fd = {shutdown_event, POLLIN, 0};
+    return poll(&fd, 1, timeout) > 0;
 }
 
 Server* Server::create(Args args) {
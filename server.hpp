@@ -2,13 +2,66 @@
 #define __SERVER_HPP__
 
 #include "args.hpp"
+#include "config.hpp"
+#include "handoff.hpp"
+
+/**
+ * Reason why Server::wait returned
+ */
+enum class Wake {
+    // Socket is readable
+    Ready,
+    // New process wants to take over the server socket
+    Handoff,
+    // Server was interrupted and should shut down
+    Shutdown,
+};
 
 class Server {
    protected:
     Args args;
+    Config config;
+    Handoff handoff;
+    // Server socket was passed to a new process
+    bool handed_off = false;
+
+    /**
+     * Get server socket, either from the running process or a newly bound one
+     * @param type SOCK_STREAM or SOCK_DGRAM
+     */
+    int open_socket(int type);
+    /**
+     * Wait until the socket is readable, reload config when requested meanwhile
+     * @param socket Socket to wait on
+     */
+    Wake wait(int socket);
+    /**
+     * Pass server socket to the new process that wants to take over
+     * @param socket Server socket
+     * @return False if the socket wasn't passed (keep serving then)
+     */
+    bool hand_off(int socket);
+    /**
+     * Pass server socket to the new process accepted by `handoff`
+     * Saves the snapshot first, so the new process can load it
+     * @param socket Server socket
+     * @return False if the socket wasn't passed (keep serving then)
+     */
+    bool send_socket(int socket);
+    /**
+     * Wait for shutdown request
+     * @param timeout Maximum time to wait in milliseconds
+     * @return True if the server should shut down
+     */
+    bool wait_shutdown(int timeout);
+    /**
+     * Apply reloaded config
+     */
+    virtual void apply_config(){};
 
    public:
     Server(Args args);
+    virtual ~Server();
     static Server* create(Args args);
     virtual void run(){};
 };
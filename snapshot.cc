@@ -0,0 +1,216 @@
+#include "snapshot.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cache.hpp"
+
+namespace snapshot {
+
+/**
+ * Header of the snapshot file
+ */
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t checksum;
+    uint32_t length;
+};
+
+constexpr char magic[8] = {'I', 'P', 'K', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t version = 1;
+// Size of the fixed part of an entry (result, hits, query length)
+constexpr size_t entry_size = 9;
+// Maximum number of entries in the snapshot
+constexpr size_t max_entries = 1 << 16;
+
+// Path to the snapshot file
+std::string snapshot_path;
+// Seconds between saves
+std::atomic<unsigned> interval{60};
+// Mutex for writing the snapshot file
+std::mutex save_mutex;
+
+// Background threads, joined only by stop(), so fatal exit() doesn't destroy joinable threads
+std::thread* loader = nullptr;
+std::thread* saver = nullptr;
+// Wakes the saver when it should stop
+std::mutex saver_mutex;
+std::condition_variable saver_condition;
+bool saving = false;
+
+/**
+ * FNV-1a checksum
+ */
+uint32_t checksum(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool load(std::string path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const uint8_t* data = (const uint8_t*)map;
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    const uint8_t* entries = data + sizeof(header);
+    bool valid = memcmp(header.magic, magic, sizeof(magic)) == 0 && header.version == version &&
+                 header.length == size - sizeof(header) &&
+                 header.checksum == checksum(entries, header.length);
+
+    // Check structure of all entries first, so invalid snapshot isn't half loaded
+    size_t pos = 0;
+    for (uint32_t i = 0; valid && i < header.count; i++) {
+        if (pos + entry_size > header.length) {
+            valid = false;
+            break;
+        }
+        pos += entry_size + entries[pos + 8];
+    }
+    valid = valid && pos == header.length;
+
+    // Entries are read straight from the mapping
+    pos = 0;
+    for (uint32_t i = 0; valid && i < header.count; i++) {
+        int32_t result;
+        uint32_t hits;
+        memcpy(&result, entries + pos, sizeof(result));
+        memcpy(&hits, entries + pos + 4, sizeof(hits));
+        size_t length = entries[pos + 8];
+        pos += entry_size;
+        result_cache.insert(std::string((const char*)entries + pos, length), result, hits);
+        pos += length;
+    }
+
+    munmap(map, size);
+    if (!valid) {
+        std::cerr << "Invalid snapshot " << path << std::endl;
+    }
+    return valid;
+}
+
+bool save(std::string path) {
+    // Serialize entries first, so the checksum can go to the header
+    std::vector<uint8_t> entries;
+    auto hot = result_cache.hot(max_entries);
+    for (auto& entry : hot) {
+        uint8_t fixed[entry_size];
+        int32_t result = entry.result;
+        memcpy(fixed, &result, sizeof(result));
+        memcpy(fixed + 4, &entry.hits, sizeof(entry.hits));
+        fixed[8] = entry.query.length();
+        entries.insert(entries.end(), fixed, fixed + entry_size);
+        entries.insert(entries.end(), entry.query.begin(), entry.query.end());
+    }
+
+    Header header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.count = hot.size();
+    header.checksum = checksum(entries.data(), entries.size());
+    header.length = entries.size();
+
+    // Write to temporary file and rename, so readers never see partial snapshot
+    // Temporary file is per process, old and new process save concurrently during handoff
+    std::lock_guard<std::mutex> lock(save_mutex);
+    std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        perror("fopen");
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(entries.data(), 1, entries.size(), file) == entries.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tmp.c_str(), path.c_str()) < 0) {
+        perror("snapshot");
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Save snapshot every `interval` seconds until saving is stopped
+ */
+void save_loop(std::string path) {
+    std::unique_lock<std::mutex> lock(saver_mutex);
+    while (saving) {
+        // Changed interval is used from the next save
+        if (saver_condition.wait_for(lock, std::chrono::seconds(interval.load()),
+                                     [] { return !saving; })) {
+            break;
+        }
+        lock.unlock();
+        save(path);
+        lock.lock();
+    }
+}
+
+void start_loading(std::string path) {
+    // Load in background, so the server starts accepting right away
+    loader = new std::thread([path] { load(path); });
+}
+
+void start_saving(std::string path, unsigned save_interval) {
+    snapshot_path = path;
+    set_interval(save_interval);
+    saving = true;
+    saver = new std::thread(save_loop, path);
+}
+
+void stop(bool save_now) {
+    if (loader != nullptr) {
+        loader->join();
+        delete loader;
+        loader = nullptr;
+    }
+    if (saver == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(saver_mutex);
+        saving = false;
+    }
+    saver_condition.notify_one();
+    saver->join();
+    delete saver;
+    saver = nullptr;
+    if (save_now) {
+        save(snapshot_path);
+    }
+}
+
+void set_interval(unsigned save_interval) {
+    interval.store(save_interval, std::memory_order_relaxed);
+}
+
+}  // namespace snapshot
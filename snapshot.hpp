@@ -0,0 +1,54 @@
+#ifndef __SNAPSHOT_HPP__
+#define __SNAPSHOT_HPP__
+
+#include <string>
+
+/**
+ * Persistent snapshot of hot result cache entries
+ *
+ * File format (native byte order):
+ *   header: magic "IPKSNAP\0", uint32 version, uint32 entry count,
+ *           uint32 checksum (FNV-1a of the entries), uint32 length of the entries
+ *   entry:  int32 result, uint32 hits, uint8 query length, query
+ */
+namespace snapshot {
+
+/**
+ * Load snapshot into the result cache in background
+ * @param path Path to the snapshot file
+ */
+void start_loading(std::string path);
+
+/**
+ * Save snapshot periodically in background
+ * @param path Path to the snapshot file
+ * @param interval Seconds between saves
+ */
+void start_saving(std::string path, unsigned interval);
+
+/**
+ * Wait for background loading and stop periodic saving
+ * @param save_now Save the snapshot once more (when saving was started)
+ */
+void stop(bool save_now);
+
+/**
+ * Change interval between saves
+ */
+void set_interval(unsigned interval);
+
+/**
+ * Load snapshot into the result cache
+ * @return False if the file is missing or invalid
+ */
+bool load(std::string path);
+
+/**
+ * Save hot entries of the result cache
+ * @return False if the file can't be written
+ */
+bool save(std::string path);
+
+}  // namespace snapshot
+
+#endif  // __SNAPSHOT_HPP__
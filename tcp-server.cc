@@ -1,13 +1,14 @@
 #include "tcp-server.hpp"
 #include <arpa/inet.h>
-#include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <chrono>
 #include <mutex>
 #include <regex>
 #include <thread>
 #include <vector>
 #include "parser.hpp"
+#include "trace.hpp"
 
 // Regex patterns for parsing messages
 const std::regex re_hello("^HELLO\n");
@@ -26,6 +27,7 @@ std::mutex mutex;
  * @param message Message to send
  */
 void send_message(int client_socket, std::string message) {
+    trace::Scope scope(Stage::Send);
     send(client_socket, message.c_str(), message.length(), 0);
 }
 
@@ -38,16 +40,27 @@ void client_handler(int client_socket) {
     Parser parser;
     bool hello_received = false;
     std::string msg;
+    // Whether the current message already started a traced request
+    bool request_started = false;
 
     while (true) {
+        // Each message is a single request for tracing, including reads of its parts
+        if (!request_started) {
+            trace::begin_request();
+            request_started = true;
+        }
         // Check if the message contains a newline
         std::size_t pos = msg.find('\n');
         if (pos == std::string::npos) {
             // No newline, continue receiving
             // Receive a message from the client
             char buffer[1024] = {0};
-            int valread = read(client_socket, buffer, 1023);
-            if (valread == 0) {
+            int valread;
+            {
+                trace::Scope scope(Stage::Read);
+                valread = read(client_socket, buffer, 1023);
+            }
+            if (valread <= 0) {
                 // Client disconnected
                 break;
             }
@@ -55,11 +68,18 @@ void client_handler(int client_socket) {
             msg += buffer;
             continue;
         }
+        // Message is complete, next one will be a new request
+        request_started = false;
 
         std::smatch match;
         // If we haven't received a HELLO message yet, check if the message is a HELLO message
         if (!hello_received) {
-            if (std::regex_search(msg, match, re_hello)) {
+            bool matched;
+            {
+                trace::Scope scope(Stage::Match);
+                matched = std::regex_search(msg, match, re_hello);
+            }
+            if (matched) {
                 // Remove HELLO from the message
                 msg.erase(0, pos + 1);
                 // Reply with a HELLO message
@@ -77,7 +97,12 @@ void client_handler(int client_socket) {
          * or BYE messages, but we don't need to check for that,
          * because any non-SOLVE message will cause the client to disconnect
          */
-        if (std::regex_search(msg, match, re_solve)) {
+        bool matched;
+        {
+            trace::Scope scope(Stage::Match);
+            matched = std::regex_search(msg, match, re_solve);
+        }
+        if (matched) {
             auto result = parser.parse(match[1].str());
             // TCP mode doesn't support negative results
             if (result.has_value() && result.value() >= 0) {
@@ -107,58 +132,60 @@ void client_handler(int client_socket) {
 }
 
 /**
- * TCP signal handler
+ * Send a BYE message to all clients and shut their connections down
+ * Client threads then close the sockets themselves
  */
-void tcp_signalhandler(int signum) {
-    // We can't lock the mutex because it could be locked by a client thread
-    // Send a BYE message to all clients
+void bye_clients() {
+    mutex.lock();
     for (auto& client : clients) {
         send_message(client, "BYE\n");
-        close(client);
+        shutdown(client, SHUT_RDWR);
     }
-    // Close the server socket
-    close(sock_tcp);
-    exit(EXIT_SUCCESS);
+    mutex.unlock();
 }
 
-void TcpServer::run() {
-    int new_socket;
-    int opt = 1;
-    int addrlen = sizeof(args.address);
+/**
+ * Check if all clients have disconnected
+ */
+bool clients_empty() {
+    mutex.lock();
+    bool empty = clients.empty();
+    mutex.unlock();
+    return empty;
+}
 
-    if ((sock_tcp = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+void TcpServer::apply_config() {
+    // Listening again only changes the queue length
+    if (listen(sock_tcp, config.backlog) < 0) {
+        perror("listen");
     }
+}
 
-    // Attach socket to the port
-    if (setsockopt(sock_tcp, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("setsockopt");
-        exit(EXIT_FAILURE);
-    }
+void TcpServer::run() {
+    int new_socket;
+    int addrlen = sizeof(args.address);
 
-    // Bind socket to the address and port
-    if (bind(sock_tcp, (struct sockaddr*)&args.address, addrlen) < 0) {
-        perror("bind");
-        exit(EXIT_FAILURE);
-    }
+    sock_tcp = open_socket(SOCK_STREAM);
 
     // Start listening for connections
-    if (listen(sock_tcp, 3) < 0) {
+    if (listen(sock_tcp, config.backlog) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    // Set up the signal handler
-    struct sigaction a;
-    a.sa_handler = tcp_signalhandler;
-    a.sa_flags = 0;
-    sigemptyset(&a.sa_mask);
-    sigaction(SIGINT, &a, NULL);
-
     // Accept new connections and start a new thread for each client
     while (true) {
-        // Wait for new connections
+        // Wait for new connections (or for a new process taking over)
+        Wake wake = wait(sock_tcp);
+        if (wake == Wake::Shutdown) {
+            break;
+        }
+        if (wake == Wake::Handoff) {
+            if (hand_off(sock_tcp)) {
+                break;
+            }
+            continue;
+        }
         if ((new_socket = accept(sock_tcp, (struct sockaddr*)&args.address, (socklen_t*)&addrlen)) <
             0) {
             break;
@@ -171,4 +198,20 @@ void TcpServer::run() {
         client_thread.detach();
         mutex.unlock();
     }
+    close(sock_tcp);
+
+    // New process accepts connections now, let existing clients finish in time
+    if (handed_off) {
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(config.drain_timeout);
+        while (!clients_empty() && std::chrono::steady_clock::now() < deadline &&
+               !wait_shutdown(100)) {
+        }
+    }
+
+    // Disconnect remaining clients and give their threads a moment to finish
+    bye_clients();
+    for (int i = 0; i < 10 && !clients_empty(); i++) {
+        usleep(100000);
+    }
 }
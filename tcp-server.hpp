@@ -7,6 +7,8 @@
 class TcpServer : public Server {
     using Server::Server;
 
+    void apply_config();
+
    public:
     void run();
 };
@@ -1,7 +1,15 @@
 """Tests for server implementation"""
 
-import unittest
+import os
+import signal
 import socket
+import struct
+import subprocess
+import tempfile
+import time
+import unittest
+
+import trace2json
 
 
 class TestTCP(unittest.TestCase):
@@ -66,6 +74,23 @@ class TestTCP(unittest.TestCase):
         self.assertEqual(self.send_message(
             b"HELLO\nSOLVE (/ 10 0)\n"), b"HELLO\nBYE\n")
 
+    def test_division_by_zero_late(self):
+        """HELLO SOLVE (/ 1000 2 5 0 1) BYE"""
+        self.assertEqual(self.send_message(
+            b"HELLO\nSOLVE (/ 1000 2 5 0 1)\n"), b"HELLO\nBYE\n")
+
+    def test_division_overflow(self):
+        """HELLO SOLVE (/ (- 0 2147483647 1) (- 0 1)) BYE"""
+        self.assertEqual(self.send_message(
+            b"HELLO\nSOLVE (/ (- 0 2147483647 1) (- 0 1))\n"), b"HELLO\nBYE\n")
+
+    def test_wide_operations(self):
+        """HELLO SOLVE (- 100 1 ... 1) SOLVE (* 1 2 ... 10) BYE"""
+        self.assertEqual(self.send_message(
+            b"HELLO\nSOLVE (-" + (b" 100") + (b" 1" * 19) + b")\n" +
+            b"SOLVE (* 1 2 3 4 5 6 7 8 9 10)\nBYE\n"),
+            b"HELLO\nRESULT 81\nRESULT 3628800\nBYE\n")
+
     def test_large_solve(self):
         """HELLO SOLVE (+ (1 1 ... 1)) BYE"""
         self.assertEqual(self.send_message(
@@ -76,6 +101,11 @@ class TestTCP(unittest.TestCase):
         self.assertEqual(self.send_message(
             b"HELLO\nSOLVE (+ 1 (* 2 3) (/ 8 4))\nBYE\n"), b"HELLO\nRESULT 9\nBYE\n")
 
+    def test_repeated_solve(self):
+        """HELLO SOLVE (* 6 7) SOLVE (* 6 7) BYE"""
+        self.assertEqual(self.send_message(
+            b"HELLO\nSOLVE (* 6 7)\nSOLVE (* 6 7)\nBYE\n"), b"HELLO\nRESULT 42\nRESULT 42\nBYE\n")
+
     def test_invalid_expression(self):
         """HELLO SOLVE (1 2 3)"""
         self.assertEqual(self.send_message(
@@ -115,10 +145,12 @@ class TestTCP(unittest.TestCase):
 class TestUDP(unittest.TestCase):
     """UDP tests"""
 
+    port = 1235
+
     def send_message(self, message):
         """Send a message to the server and return the response"""
         sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-        sock.sendto(message, ("127.0.0.1", 1235))
+        sock.sendto(message, ("127.0.0.1", self.port))
         response, _ = sock.recvfrom(1024)
         sock.close()
         return response
@@ -153,5 +185,294 @@ class TestUDP(unittest.TestCase):
                          b'\x01\x00\x02-1')
 
 
+@unittest.skipUnless("IPKCPD_PACKET_LOG" in os.environ, "run with make test_packet")
+class TestUDPPacket(TestUDP):
+    """UDP tests with packet ring backend"""
+
+    port = 1236
+
+    def test_ring_active(self):
+        """Server didn't fall back to socket backend"""
+        with open(os.environ["IPKCPD_PACKET_LOG"], encoding="utf-8") as log:
+            self.assertNotIn("falling back", log.read())
+
+
+@unittest.skipUnless("IPKCPD_FALLBACK_LOG" in os.environ, "run with make test")
+class TestUDPPacketFallback(TestUDP):
+    """UDP tests with packet ring backend falling back to socket (no loopback sysctls)"""
+
+    port = 1237
+
+    def test_fallback(self):
+        """Server fell back to socket backend"""
+        with open(os.environ["IPKCPD_FALLBACK_LOG"], encoding="utf-8") as log:
+            self.assertIn("falling back", log.read())
+
+
+class ServerTestCase(unittest.TestCase):
+    """Base for tests that start their own server processes"""
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.processes = []
+
+    def tearDown(self):
+        for process in self.processes:
+            if process.poll() is None:
+                process.send_signal(signal.SIGINT)
+            process.communicate(timeout=5)
+        self.tmp.cleanup()
+
+    def path(self, name):
+        """Path to a file in the temporary directory"""
+        return os.path.join(self.tmp.name, name)
+
+    def write_config(self, content):
+        """Write config file and return its path"""
+        with open(self.path("ipkcpd.conf"), "w", encoding="utf-8") as config:
+            config.write(content)
+        return self.path("ipkcpd.conf")
+
+    def start(self, port, *args, mode="tcp"):
+        """Start server and give it a moment to set up"""
+        process = subprocess.Popen(
+            ["./ipkcpd", "-h", "127.0.0.1", "-p", str(port), "-m", mode, *args],
+            stderr=subprocess.PIPE)
+        self.processes.append(process)
+        time.sleep(0.2)
+        return process
+
+    def connect(self, port):
+        """Connect to TCP server and greet it"""
+        sock = socket.create_connection(("127.0.0.1", port))
+        sock.settimeout(5)
+        sock.sendall(b"HELLO\n")
+        self.assertEqual(sock.recv(1024), b"HELLO\n")
+        return sock
+
+    def solve(self, sock, expression):
+        """Send SOLVE message and return the response"""
+        sock.sendall(b"SOLVE " + expression + b"\n")
+        return sock.recv(1024)
+
+
+class TestHandoff(ServerTestCase):
+    """Zero-downtime restart tests"""
+
+    def test_handoff(self):
+        """New process takes over, old one finishes its clients"""
+        old = self.start(1240, "-u", self.path("control"))
+        client = self.connect(1240)
+        new = self.start(1240, "-u", self.path("control"))
+        # Old process still serves its client
+        self.assertEqual(self.solve(client, b"(+ 1 2)"), b"RESULT 3\n")
+        self.assertIsNone(old.poll())
+        client.sendall(b"BYE\n")
+        client.close()
+        self.assertEqual(old.wait(5), 0)
+        # New process serves new clients
+        client = self.connect(1240)
+        self.assertEqual(self.solve(client, b"(* 2 3)"), b"RESULT 6\n")
+        client.close()
+        self.assertIsNone(new.poll())
+
+    def test_drain_timeout(self):
+        """Idle client doesn't keep old process alive"""
+        config = self.write_config("drain_timeout = 1\n")
+        old = self.start(1241, "-u", self.path("control"), "-c", config)
+        client = self.connect(1241)
+        self.start(1241, "-u", self.path("control"))
+        self.assertIsNone(old.poll())
+        self.assertEqual(old.wait(5), 0)
+        self.assertEqual(client.recv(1024), b"BYE\n")
+        client.close()
+
+    def test_mode_mismatch(self):
+        """Process with different mode is refused and old one keeps serving"""
+        old = self.start(1242, "-u", self.path("control"))
+        new = self.start(1242, "-u", self.path("control"), mode="udp")
+        _, stderr = new.communicate(timeout=5)
+        self.assertEqual(new.returncode, 1)
+        self.assertIn(b"different mode", stderr)
+        self.assertIsNone(old.poll())
+        client = self.connect(1242)
+        self.assertEqual(self.solve(client, b"(+ 1 2)"), b"RESULT 3\n")
+        client.close()
+
+    def test_address_mismatch(self):
+        """Process with different port is refused and old one keeps serving"""
+        old = self.start(1245, "-u", self.path("control"))
+        new = self.start(1246, "-u", self.path("control"))
+        _, stderr = new.communicate(timeout=5)
+        self.assertEqual(new.returncode, 1)
+        self.assertIn(b"different mode or address", stderr)
+        self.assertIsNone(old.poll())
+        client = self.connect(1245)
+        self.assertEqual(self.solve(client, b"(+ 1 2)"), b"RESULT 3\n")
+        client.close()
+
+
+class TestReload(ServerTestCase):
+    """Config reload tests"""
+
+    def reload(self, process, content):
+        """Rewrite config and let the server reload it"""
+        self.write_config(content)
+        process.send_signal(signal.SIGHUP)
+        time.sleep(0.2)
+
+    def backlog(self, port):
+        """Listen queue length of the server socket"""
+        output = subprocess.run(["ss", "-Hltn", f"sport = :{port}"],
+                                capture_output=True, check=True).stdout
+        return int(output.split()[2])
+
+    def test_backlog(self):
+        """backlog"""
+        process = self.start(1243, "-c", self.write_config("backlog = 3\n"))
+        self.assertEqual(self.backlog(1243), 3)
+        self.reload(process, "backlog = 7\n")
+        self.assertEqual(self.backlog(1243), 7)
+        # Invalid config is ignored
+        self.reload(process, "backlog = x\n")
+        self.assertEqual(self.backlog(1243), 7)
+        self.assertIsNone(process.poll())
+
+    def test_trace_rate(self):
+        """trace_rate"""
+        trace = self.path("trace.bin")
+        process = self.start(1244, "-t", trace, "-c", self.write_config("trace_rate = 1000\n"))
+        if not os.path.exists(trace):
+            self.skipTest("tracing is not compiled in")
+        client = self.connect(1244)
+        self.reload(process, "trace_rate = 1\n")
+        for i in range(5):
+            self.assertEqual(self.solve(client, b"(+ 1 %d)" % i), b"RESULT %d\n" % (i + 1))
+        client.close()
+        process.send_signal(signal.SIGINT)
+        process.wait(5)
+        with open(trace, "rb") as f:
+            requests = {event["args"]["request"] for event in trace2json.convert(f.read())}
+        # Only the first request would be traced without reload
+        self.assertGreaterEqual(len(requests), 5)
+
+
+SNAPSHOT_HEADER = struct.Struct("=8sIIII")
+SNAPSHOT_ENTRY = struct.Struct("=iIB")
+
+
+def fnv1a(data):
+    """Checksum used by the snapshot file"""
+    checksum = 2166136261
+    for byte in data:
+        checksum = ((checksum ^ byte) * 16777619) & 0xffffffff
+    return checksum
+
+
+class TestSnapshot(ServerTestCase):
+    """Result cache snapshot tests"""
+
+    def write_snapshot(self, entries, version=1, checksum=None, truncate=0, count=None):
+        """Write snapshot with given query results, optionally corrupted"""
+        data = b""
+        for query, result in entries.items():
+            data += SNAPSHOT_ENTRY.pack(result, 1, len(query)) + query
+        if checksum is None:
+            checksum = fnv1a(data)
+        if count is None:
+            count = len(entries)
+        header = SNAPSHOT_HEADER.pack(b"IPKSNAP\0", version, count, checksum, len(data))
+        with open(self.path("snapshot"), "wb") as snapshot:
+            snapshot.write((header + data)[:len(header + data) - truncate])
+        return self.path("snapshot")
+
+    def read_snapshot(self):
+        """Read snapshot and return query results"""
+        with open(self.path("snapshot"), "rb") as snapshot:
+            data = snapshot.read()
+        magic, version, count, checksum, length = SNAPSHOT_HEADER.unpack_from(data)
+        entries = data[SNAPSHOT_HEADER.size:]
+        self.assertEqual(magic, b"IPKSNAP\0")
+        self.assertEqual(version, 1)
+        self.assertEqual(length, len(entries))
+        self.assertEqual(checksum, fnv1a(entries))
+        results = {}
+        pos = 0
+        for _ in range(count):
+            result, _, query_length = SNAPSHOT_ENTRY.unpack_from(entries, pos)
+            pos += SNAPSHOT_ENTRY.size
+            results[entries[pos:pos + query_length]] = result
+            pos += query_length
+        self.assertEqual(pos, length)
+        return results
+
+    def test_save(self):
+        """Cached results are saved at shutdown"""
+        process = self.start(1250, "-w", self.path("snapshot"))
+        client = self.connect(1250)
+        self.assertEqual(self.solve(client, b"(+ 2 3)"), b"RESULT 5\n")
+        self.assertEqual(self.solve(client, b"(* 4 5)"), b"RESULT 20\n")
+        client.close()
+        process.send_signal(signal.SIGINT)
+        self.assertEqual(process.wait(5), 0)
+        self.assertEqual(self.read_snapshot(), {b"(+ 2 3)": 5, b"(* 4 5)": 20})
+        self.assertEqual(os.listdir(self.tmp.name), ["snapshot"])
+
+    def test_load(self):
+        """Results are served from loaded snapshot"""
+        # Wrong result shows that the cache was used
+        self.start(1251, "-w", self.write_snapshot({b"(+ 2 2)": 5}))
+        client = self.connect(1251)
+        self.assertEqual(self.solve(client, b"(+ 2 2)"), b"RESULT 5\n")
+        client.close()
+
+    def assert_rejected(self, port, path):
+        """Invalid snapshot is reported and not loaded"""
+        process = self.start(port, "-w", path)
+        client = self.connect(port)
+        self.assertEqual(self.solve(client, b"(+ 2 2)"), b"RESULT 4\n")
+        client.close()
+        process.send_signal(signal.SIGINT)
+        _, stderr = process.communicate(timeout=5)
+        self.assertIn(b"Invalid snapshot", stderr)
+
+    def test_bad_checksum(self):
+        """Snapshot with bad checksum"""
+        self.assert_rejected(1252, self.write_snapshot({b"(+ 2 2)": 5}, checksum=0))
+
+    def test_bad_version(self):
+        """Snapshot with unknown version"""
+        self.assert_rejected(1253, self.write_snapshot({b"(+ 2 2)": 5}, version=2))
+
+    def test_truncated(self):
+        """Truncated snapshot"""
+        self.assert_rejected(1254, self.write_snapshot({b"(+ 2 2)": 5}, truncate=1))
+
+    def test_count_mismatch(self):
+        """Snapshot with more entries in header than in file"""
+        self.assert_rejected(1256, self.write_snapshot({b"(+ 2 2)": 5}, count=2))
+
+    def test_trailing_data(self):
+        """Snapshot with fewer entries in header than in file"""
+        self.assert_rejected(1257, self.write_snapshot({b"(+ 2 2)": 5, b"(+ 3 3)": 7}, count=1))
+
+    def test_handoff(self):
+        """New process gets hot entries of the old one"""
+        snapshot = self.write_snapshot({b"(+ 2 2)": 5})
+        old = self.start(1255, "-w", snapshot, "-u", self.path("control"))
+        client = self.connect(1255)
+        self.assertEqual(self.solve(client, b"(* 4 5)"), b"RESULT 20\n")
+        client.close()
+        # Entry can get to the new process only from the old one
+        self.write_snapshot({})
+        self.start(1255, "-w", snapshot, "-u", self.path("control"))
+        self.assertEqual(old.wait(5), 0)
+        client = self.connect(1255)
+        self.assertEqual(self.solve(client, b"(+ 2 2)"), b"RESULT 5\n")
+        self.assertEqual(self.solve(client, b"(* 4 5)"), b"RESULT 20\n")
+        client.close()
+        self.assertEqual(self.read_snapshot(), {b"(+ 2 2)": 5, b"(* 4 5)": 20})
+
+
 if __name__ == "__main__":
     unittest.main()
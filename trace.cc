@@ -0,0 +1,241 @@
+#include "trace.hpp"
+#include <time.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace trace {
+
+/**
+ * Single traced event, this is also the record format of the trace file
+ */
+struct Event {
+    uint64_t start;
+    uint64_t end;
+    uint64_t request;
+    uint32_t thread;
+    uint8_t stage;
+    uint8_t padding[3];
+};
+
+/**
+ * Header of the trace file
+ */
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    // Events dropped because the ring was full, filled in when tracing stops
+    uint64_t dropped;
+};
+
+// Number of events in a single ring buffer
+constexpr size_t ring_size = 4096;
+// How often the rings are written to the trace file
+constexpr auto drain_interval = std::chrono::milliseconds(100);
+
+/**
+ * Single producer, single consumer ring buffer
+ * Producer is the thread owning the ring, consumer is the drain thread
+ */
+struct Ring {
+    std::array<Event, ring_size> events;
+    // Written only by producer
+    std::atomic<size_t> head{0};
+    // Written only by consumer
+    std::atomic<size_t> tail{0};
+    // Whether some thread currently owns this ring
+    std::atomic<bool> used{false};
+    uint32_t thread;
+};
+
+/**
+ * Ring owned by the current thread, gets released when the thread exits
+ */
+struct RingHandle {
+    Ring* ring = nullptr;
+    ~RingHandle();
+};
+
+thread_local bool sampled = false;
+// Id of the current request of this thread
+thread_local uint64_t request = 0;
+thread_local RingHandle handle;
+
+// All rings ever created, rings are reused by new threads
+std::vector<std::unique_ptr<Ring>> rings;
+// Mutex for accessing the list of rings
+std::mutex rings_mutex;
+// Trace file
+FILE* file = nullptr;
+// Whether tracing is running
+std::atomic<bool> active{false};
+// Sampling rate, can be changed on config reload
+std::atomic<unsigned> rate{1};
+// Number of requests seen so far (for sampling)
+std::atomic<uint64_t> requests{0};
+// Number of events dropped because the ring was full
+std::atomic<uint64_t> dropped{0};
+
+// Drain thread and its stop signal
+// Joined only by stop(), so fatal exit() elsewhere doesn't destroy a joinable thread
+std::thread* drain_thread = nullptr;
+std::mutex stop_mutex;
+std::condition_variable stop_condition;
+bool stopping = false;
+
+/**
+ * Write all events from the ring to the trace file
+ * Called only from the drain thread (or after it has stopped)
+ */
+void drain(Ring* ring) {
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t head = ring->head.load(std::memory_order_acquire);
+    while (tail != head) {
+        // Write contiguous part of the ring at once
+        size_t start = tail % ring_size;
+        size_t count = std::min(head - tail, ring_size - start);
+        fwrite(&ring->events[start], sizeof(Event), count, file);
+        tail += count;
+    }
+    ring->tail.store(tail, std::memory_order_release);
+}
+
+/**
+ * Drain all rings
+ */
+void drain_all() {
+    std::vector<Ring*> current;
+    {
+        // Rings are never freed, so they can be drained without holding the lock
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (auto& ring : rings) {
+            current.push_back(ring.get());
+        }
+    }
+    for (auto* ring : current) {
+        drain(ring);
+    }
+}
+
+/**
+ * Drain thread, writes rings to the trace file until stopped
+ */
+void drain_loop() {
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    while (!stopping) {
+        stop_condition.wait_for(lock, drain_interval);
+        drain_all();
+    }
+}
+
+RingHandle::~RingHandle() {
+    if (ring != nullptr) {
+        ring->used.store(false, std::memory_order_release);
+    }
+}
+
+/**
+ * Get ring of the current thread, reuse free ring or create a new one
+ */
+Ring* get_ring() {
+    if (handle.ring != nullptr) {
+        return handle.ring;
+    }
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (auto& ring : rings) {
+        bool expected = false;
+        if (ring->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            handle.ring = ring.get();
+            return handle.ring;
+        }
+    }
+    rings.push_back(std::make_unique<Ring>());
+    handle.ring = rings.back().get();
+    handle.ring->thread = rings.size();
+    handle.ring->used.store(true, std::memory_order_relaxed);
+    return handle.ring;
+}
+
+void init(std::string path, unsigned sampling_rate) {
+    if (!enabled) {
+        std::cerr << "Tracing is not compiled in, rebuild with 'make TRACE=1'" << std::endl;
+        return;
+    }
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    Header header = {{'I', 'P', 'K', 'T', 'R', 'A', 'C', 'E'}, 2, sizeof(Event), 0};
+    fwrite(&header, sizeof(header), 1, file);
+    set_rate(sampling_rate);
+    drain_thread = new std::thread(drain_loop);
+    active.store(true, std::memory_order_release);
+}
+
+void stop() {
+    if (!active.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_condition.notify_one();
+    drain_thread->join();
+    delete drain_thread;
+    drain_thread = nullptr;
+    drain_all();
+
+    // Store number of dropped events in the header
+    uint64_t count = dropped.load();
+    fseek(file, offsetof(Header, dropped), SEEK_SET);
+    fwrite(&count, sizeof(count), 1, file);
+    fclose(file);
+    if (count > 0) {
+        std::cerr << "Tracing dropped " << count << " events" << std::endl;
+    }
+}
+
+void set_rate(unsigned sampling_rate) {
+    rate.store(sampling_rate, std::memory_order_relaxed);
+}
+
+void sample() {
+    if (!active.load(std::memory_order_relaxed)) {
+        sampled = false;
+        return;
+    }
+    unsigned current_rate = rate.load(std::memory_order_relaxed);
+    request = requests.fetch_add(1, std::memory_order_relaxed);
+    sampled = request % current_rate == 0;
+}
+
+void record(Stage stage, uint64_t start, uint64_t end) {
+    Ring* ring = get_ring();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    // Ring is full, drop the event rather than wait for the drain thread
+    if (head - ring->tail.load(std::memory_order_acquire) == ring_size) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->events[head % ring_size] = {start, end, request, ring->thread, (uint8_t)stage, {0}};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+}  // namespace trace
@@ -0,0 +1,116 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Stages of a request that can be traced
+ */
+enum class Stage : uint8_t { Read, Match, Tokenize, Evaluate, Send };
+
+namespace trace {
+
+// Tracing is compiled in only when building with TRACE=1 (see Makefile)
+#ifdef TRACE
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// Whether the current request of this thread is sampled
+extern thread_local bool sampled;
+
+/**
+ * Open trace file and set sampling rate
+ * @param path Path to the binary trace file
+ * @param rate Trace one in every `rate` requests
+ */
+void init(std::string path, unsigned rate);
+
+/**
+ * Stop tracing and write remaining events to the trace file
+ */
+void stop();
+
+/**
+ * Change sampling rate
+ * @param rate Trace one in every `rate` requests
+ */
+void set_rate(unsigned rate);
+
+/**
+ * Decide whether the current request of this thread will be traced
+ */
+void sample();
+
+/**
+ * Store event in the ring buffer of the current thread
+ */
+void record(Stage stage, uint64_t start, uint64_t end);
+
+/**
+ * Monotonic timestamp in nanoseconds
+ */
+uint64_t now();
+
+/**
+ * Mark start of a new request on the current thread
+ */
+inline void begin_request() {
+    if constexpr (enabled) {
+        sample();
+    }
+}
+
+/**
+ * Timestamp for a stage that runs before its request is started
+ * @return Timestamp or 0 when tracing is compiled out
+ */
+inline uint64_t timestamp() {
+    if constexpr (enabled) {
+        return now();
+    }
+    return 0;
+}
+
+/**
+ * Record stage measured with `timestamp()` once the request is started
+ * Used for reads, which are a request only when they return a message
+ */
+inline void record_stage(Stage stage, uint64_t start, uint64_t end) {
+    if constexpr (enabled) {
+        if (sampled) {
+            record(stage, start, end);
+        }
+    }
+}
+
+/**
+ * Measures single stage of a request for as long as it is in scope
+ * When tracing is compiled out, this is empty and gets optimized away
+ */
+class Scope {
+    Stage stage;
+    uint64_t start = 0;
+
+   public:
+    Scope(Stage stage) : stage(stage) {
+        if constexpr (enabled) {
+            if (sampled) {
+                start = now();
+            }
+        }
+    }
+    ~Scope() {
+        if constexpr (enabled) {
+            if (sampled) {
+                record(stage, start, now());
+            }
+        }
+    }
+};
+
+}  // namespace trace
+
+#endif  // __TRACE_HPP__
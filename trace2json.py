@@ -0,0 +1,41 @@
+"""Convert binary trace file written by ipkcpd to Chrome trace JSON"""
+
+import json
+import struct
+import sys
+
+HEADER = struct.Struct("<8sIIQ")
+EVENT = struct.Struct("<QQQIB3x")
+STAGES = ["read", "match", "tokenize", "evaluate", "send"]
+
+
+def convert(data):
+    """Convert trace file contents to list of Chrome trace events"""
+    magic, version, event_size, dropped = HEADER.unpack_from(data)
+    if magic != b"IPKTRACE" or version != 2 or event_size != EVENT.size:
+        raise ValueError("Unsupported trace file")
+    if dropped:
+        print(f"Warning: {dropped} events were dropped", file=sys.stderr)
+    events = []
+    for offset in range(HEADER.size, len(data) - EVENT.size + 1, EVENT.size):
+        start, end, request, thread, stage = EVENT.unpack_from(data, offset)
+        events.append({
+            "name": STAGES[stage],
+            "ph": "X",
+            "ts": start / 1000,
+            "dur": (end - start) / 1000,
+            "pid": 1,
+            "tid": thread,
+            "args": {"request": request},
+        })
+    return events
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: trace2json.py <trace file> <output json>")
+        sys.exit(1)
+    with open(sys.argv[1], "rb") as f:
+        trace_events = convert(f.read())
+    with open(sys.argv[2], "w", encoding="utf-8") as f:
+        json.dump({"traceEvents": trace_events}, f)
@@ -1,10 +1,11 @@
 #include "udp-server.hpp"
 #include <netinet/in.h>
-#include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <iostream>
+#include "packet-ring.hpp"
 #include "parser.hpp"
+#include "trace.hpp"
 
 /**
  * Valid opcodes
@@ -24,93 +25,140 @@ enum class Status {
 
 // Server socket
 int sock_udp;
+// Maximum number of requests served between two polls
+const int max_burst = 64;
 
 /**
- * UDP signal handler
- */
-void udp_signalhandler(int signum) {
-    // Close the server socket
-    close(sock_udp);
-    exit(EXIT_SUCCESS);
-}
-
-/**
- * Send helper function
- * @param addr Address of the client
+ * Write response to the buffer
+ * @param buffer Buffer for the response (at least 258 bytes)
  * @param status Status code
  * @param message Message to send
+ * @return Length of the response
  */
-void send_message(struct sockaddr_in* addr, Status status, std::string message) {
-    char buffer[1024];
+size_t write_response(char* buffer, Status status, std::string message) {
     buffer[0] = (char)Opcode::Response;
     buffer[1] = (char)status;
     buffer[2] = message.length();
     message.copy(buffer + 3, message.length());
+    return message.length() + 3;
+}
 
-    int len = sizeof(*addr);
-    int n = message.length() + 3;
-    sendto(sock_udp, buffer, n, MSG_CONFIRM, (const struct sockaddr*)addr, len);
+/**
+ * Process single request and write the response
+ * Shared by socket and packet ring backends
+ * @param parser Parser for evaluating expressions
+ * @param request Received message
+ * @param n Length of the received message
+ * @param response Buffer for the response (at least 258 bytes)
+ * @return Length of the response
+ */
+size_t handle_request(Parser& parser, const char* request, size_t n, char* response) {
+    // Only accept requests
+    if (n < 1 || request[0] != (char)Opcode::Request) {
+        return write_response(response, Status::Error, "Invalid opcode");
+    }
+
+    // Check if the length is valid
+    if (n < 2 || n - 2 < (uint8_t)request[1] || (uint8_t)request[1] == 0) {
+        return write_response(response, Status::Error, "Invalid length");
+    }
+
+    // Parse message
+    std::string message(request + 2, (uint8_t)request[1]);
+    auto result = parser.parse(message);
+    if (result.has_value()) {
+        return write_response(response, Status::Ok, std::to_string(result.value()));
+    } else {
+        return write_response(response, Status::Error, "Error evaluating expression");
+    }
+}
+
+/**
+ * Serve requests from the packet ring
+ * @param parser Parser for evaluating expressions
+ * @return True if the server socket was handed off to a new process or the server shut down
+ */
+bool UdpServer::run_packet_ring(Parser& parser) {
+    Wake wake = Wake::Ready;
+    {
+        PacketRing ring;
+        if (!ring.setup(args.address, sock_udp)) {
+            std::cerr << "Packet ring is not available, falling back to socket" << std::endl;
+            return false;
+        }
+        // Returns only when a new process wants to take over or on shutdown
+        ring.run(
+            [&parser](const char* request, size_t n, char* response) {
+                return handle_request(parser, request, n, response);
+            },
+            [this, &wake](int socket) {
+                // Refused process doesn't stop the ring
+                while ((wake = wait(socket)) == Wake::Handoff && !handoff.accept(sock_udp)) {
+                }
+                return wake == Wake::Ready;
+            });
+    }
+    if (wake == Wake::Shutdown) {
+        return true;
+    }
+    // Ring is closed now, so the socket queues requests for the new process again
+    // If sending fails, we continue on the socket path
+    return send_socket(sock_udp);
 }
 
 void UdpServer::run() {
     Parser parser;
-    int new_socket;
-    int opt = 1;
     socklen_t len;
     struct sockaddr_in client_addr;
-    int addrlen = sizeof(args.address);
     char buffer[1024];
 
-    if ((sock_udp = socket(AF_INET, SOCK_DGRAM, 0)) == 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
-    }
-
-    // Attach socket to the port
-    if (setsockopt(sock_udp, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("setsockopt");
-        exit(EXIT_FAILURE);
-    }
+    sock_udp = open_socket(SOCK_DGRAM);
 
-    // Bind socket to the address and port
-    if (bind(sock_udp, (struct sockaddr*)&args.address, addrlen) < 0) {
-        perror("bind");
-        exit(EXIT_FAILURE);
+    // Try the packet ring fast path first
+    if (args.backend == "packet" && run_packet_ring(parser)) {
+        close(sock_udp);
+        return;
     }
 
-    // Set up the signal handler
-    struct sigaction a;
-    a.sa_handler = udp_signalhandler;
-    a.sa_flags = 0;
-    sigemptyset(&a.sa_mask);
-    sigaction(SIGINT, &a, NULL);
-
     // Recieve and send loop
     while (true) {
-        // Recieve message
-        len = sizeof(client_addr);
-        ssize_t n =
-            recvfrom(sock_udp, buffer, 1024, MSG_WAITALL, (struct sockaddr*)&client_addr, &len);
-
-        // Only accept requests
-        if (buffer[0] != (char)Opcode::Request) {
-            send_message(&client_addr, Status::Error, "Invalid opcode");
-            continue;
+        // Wait for requests (or for a new process taking over)
+        Wake wake = wait(sock_udp);
+        if (wake == Wake::Shutdown) {
+            break;
         }
-
-        // Check if the length is valid
-        if (n - 2 < (uint8_t)buffer[1] || (uint8_t)buffer[1] == 0) {
-            send_message(&client_addr, Status::Error, "Invalid length");
+        if (wake == Wake::Handoff) {
+            if (hand_off(sock_udp)) {
+                break;
+            }
             continue;
         }
 
-        // Parse message and send response
-        std::string message(buffer + 2, (uint8_t)buffer[1]);
-        auto result = parser.parse(message);
-        if (result.has_value()) {
-            send_message(&client_addr, Status::Ok, std::to_string(result.value()));
-        } else {
-            send_message(&client_addr, Status::Error, "Error evaluating expression");
+        // Serve all queued requests before polling again, but not forever,
+        // so shutdown and handoff are noticed under load
+        for (int i = 0; i < max_burst; i++) {
+            // Recieve message
+            len = sizeof(client_addr);
+            uint64_t read_start = trace::timestamp();
+            ssize_t n = recvfrom(sock_udp, buffer, 1024, MSG_DONTWAIT,
+                                 (struct sockaddr*)&client_addr, &len);
+            uint64_t read_end = trace::timestamp();
+
+            // Queue is empty, the empty read isn't a request
+            if (n < 0) {
+                break;
+            }
+            trace::begin_request();
+            trace::record_stage(Stage::Read, read_start, read_end);
+
+            // Process message and send response
+            char response[258];
+            size_t response_len = handle_request(parser, buffer, n, response);
+            {
+                trace::Scope scope(Stage::Send);
+                sendto(sock_udp, response, response_len, MSG_CONFIRM,
+                       (const struct sockaddr*)&client_addr, len);
+            }
         }
     }
 
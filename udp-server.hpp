@@ -2,11 +2,14 @@
 #define __UDP_SERVER_HPP__
 
 #include "args.hpp"
+#include "parser.hpp"
 #include "server.hpp"
 
 class UdpServer : public Server {
     using Server::Server;
 
+    bool run_packet_ring(Parser& parser);
+
    public:
     void run();
 };